@@ -28,6 +28,7 @@ void RS_HFIQ_Service(void);                     // commands the RS_HFIQ over USB
 void printHelp(void);
 void printCPUandMemory(unsigned long curTime_millis, unsigned long updatePeriod_millis);
 void respondToByte(char c);
+void verify_error(char cmd, uint32_t requested, uint32_t reported);
 
 bool        enable_printCPUandMemory = false;   // CPU , memory and temperature
 uint32_t    VFO = 7074000;                     // Dial frequency in Hz
@@ -43,7 +44,12 @@ void setup()
     InternalTemperature.begin(TEMPERATURE_NO_ADC_SETTING_CHANGES);
     printHelp();
     
-    RS_HFIQ.setup_RSHFIQ(block, VFO);  // initialize the RS-HFIQ radio hardware
+    // Optional extra CAT programs.  Adding any port here replaces the default of Serial (+ SerialUSB1/2 if enabled).
+    //RS_HFIQ.add_CAT_port(&Serial, false);   // console, no unsolicited state messages
+    //Serial1.begin(38400);
+    //RS_HFIQ.add_CAT_port(&Serial1);         // logger on a hardware UART, gets state changes without polling
+    VFO = RS_HFIQ.setup_RSHFIQ(block, VFO);  // initialize the RS-HFIQ radio hardware.  Pass 0 to resume the last saved band and frequency
+    RS_HFIQ.set_verified_write(true, 2, verify_error);  // read back *F, *E and *B sets in the background, 2 retries
     
     Serial.print(F("\nCurrent VFO is ")); Serial.println(VFO);
     Serial.print(F("Current Band is ")); Serial.println(curr_band);
@@ -68,18 +74,15 @@ void loop()
             case 'U':   Serial.read();  // Set VFO to something new.  Can insert touch or encoder driven frequency here
                         VFO = 14074000;    
                         //curr_band = 4;      // start off with a valid band and VFO
-                        RS_HFIQ.send_variable_cmd_to_RSHFIQ("*F", RS_HFIQ.convert_freq_to_Str(VFO));
-                        delay(5);  // query sometimes returns with freq out of range, not sure why yet. Possibly cannot update quick enough. adding delay here helps
-                        RS_HFIQ.send_fixed_cmd_to_RSHFIQ("*F?");                     
-                        RS_HFIQ.print_RSHFIQ(block);
+                        RS_HFIQ.send_variable_cmd_to_RSHFIQ("*F", RS_HFIQ.convert_freq_to_Str(VFO));  // read back is done by the library
                         break;
             case 'Y':   Serial.read();  // Set VFO to something new.  Can insert touch or encoder driven frequency here
                         VFO = 21074000;    
                         //curr_band = 6;      // start off with a valid band and VFO
-                        RS_HFIQ.send_variable_cmd_to_RSHFIQ("*F", RS_HFIQ.convert_freq_to_Str(VFO));
-                        delay(5);  // sometimes returns with freq out of range, not sure why yet. Possibly cannot update quick enough.
-                        RS_HFIQ.send_fixed_cmd_to_RSHFIQ("*F?");                        
-                        RS_HFIQ.print_RSHFIQ(block);
+                        RS_HFIQ.send_variable_cmd_to_RSHFIQ("*F", RS_HFIQ.convert_freq_to_Str(VFO));  // read back is done by the library
+                        break;
+            case 'P':   Serial.read();  // binary dump of the wire traffic recorder, see extras/replay
+                        RS_HFIQ.dump_recorder(&Serial);
                         break;
             case 'C':
             case 'H':   respondToByte((char)Serial.read());   // pick off these 2 for a main menu.  
@@ -89,6 +92,8 @@ void loop()
                         break;
         }
     }
+    RS_HFIQ.service_RSHFIQ();   // background read-back of frequency sets and band stack saves
+
     //check to see whether to print the CPU and Memory Usage
     if (enable_printCPUandMemory)
         printCPUandMemory(millis(), 3000); //print every 3000 msec
@@ -129,6 +134,14 @@ void RS_HFIQ_Service(void)
     }
 }
 
+// Called by the library when a set still reads back wrong after all retries
+void verify_error(char cmd, uint32_t requested, uint32_t reported)
+{
+    Serial.print(F("RS-HFIQ *")); Serial.print(cmd); 
+    Serial.print(F(" write failed. Requested ")); Serial.print(requested);
+    Serial.print(F(" Reported ")); Serial.println(reported);
+}
+
 // Utility functions for demo
 
 void togglePrintMemoryAndCPU(void) 
@@ -199,5 +212,6 @@ void printHelp(void)
     Serial.println(F("   C: Toggle printing of CPU and Memory usage"));
     Serial.println(F("   Y: Update VFO to 21074KHz (hard coded to emulate a VFO encoder update"));
     Serial.println(F("   U: Update VFO to 14074KHz (hard coded to emulate a VFO encoder update"));
+    Serial.println(F("   P: Dump the wire traffic recorder (binary, needs RSHFIQ_RECORDER in the library)"));
     Serial.println(F("   R to display the RS-HFIQ Menu"));
 }
@@ -0,0 +1,80 @@
+//
+//      Arduino.h - host simulation
+//
+//      Just enough of the Teensy 4 Arduino API to build the RS-HFIQ library on Linux for the replay tool.
+//      Time is simulated.  It only moves when the library delays or polls an empty port, or the tool advances it.
+//
+//      Placed in the Public Domain
+//
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <deque>
+
+#define F(x)    (x)
+
+uint32_t millis(void);
+uint32_t micros(void);
+void     delay(uint32_t ms);
+static inline bool isAscii(int c) { return (c & ~0x7F) == 0; }
+
+class Print
+{
+    public:
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t * buf, size_t len);
+        size_t  write(const char * str)     { return write((const uint8_t *) str, strlen(str)); }
+        size_t  print(const char * str)     { return write(str); }
+        size_t  print(char c)               { return write((uint8_t) c); }
+        size_t  print(int n)                { return print((long) n); }
+        size_t  print(unsigned int n)       { return print((unsigned long) n); }
+        size_t  print(long n);
+        size_t  print(unsigned long n);
+        size_t  println(void)               { return write("\r\n"); }
+        template <typename T> size_t println(T v) { return print(v) + println(); }
+        int     printf(const char * fmt, ...);
+        virtual void flush(void) {}
+        virtual ~Print() {}
+};
+
+class Stream : public Print
+{
+    public:
+        virtual int available(void) = 0;
+        virtual int read(void) = 0;
+        virtual int peek(void) = 0;
+};
+
+// A simulated port.  The replay tool queues received bytes in rx.  Sent bytes go to host_output with the port's dir.
+class HostSerial : public Stream
+{
+    public:
+        HostSerial(uint8_t _out_dir) : out_dir(_out_dir) {}
+        void    begin(uint32_t baud) { (void) baud; }
+        operator bool() { return true; }
+        int     available(void);    // an empty port moves the clock so polling loops make progress
+        int     read(void);
+        int     peek(void);
+        size_t  write(uint8_t b);
+        using Print::write;
+
+        std::deque<uint8_t> rx;
+        uint8_t out_dir;            // RS_REC_xxx reported for bytes sent out this port
+};
+
+extern HostSerial Serial;
+
+// Simulation hooks used by the replay tool
+extern uint64_t host_us;                                // simulated time
+extern void   (*host_pump)(void);                       // called whenever time moves, delivers due input
+extern void   (*host_output)(uint8_t dir, uint8_t data);  // every byte the library sends
+void host_advance(uint32_t us);
+
+#endif  // _HOST_ARDUINO_H_
@@ -0,0 +1,35 @@
+//
+//      EEPROM.h - host simulation.  RAM only, starts erased each run.
+//
+//      Placed in the Public Domain
+//
+#ifndef _HOST_EEPROM_H_
+#define _HOST_EEPROM_H_
+
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE    1080    // Teensy 4.0
+#define E2END               (HOST_EEPROM_SIZE - 1)
+
+extern uint8_t host_eeprom[HOST_EEPROM_SIZE];
+
+class EEPROMClass
+{
+    public:
+        template <typename T> T & get(int addr, T & t)
+        {
+            if (addr >= 0 && addr + sizeof(T) <= HOST_EEPROM_SIZE)
+                memcpy(&t, &host_eeprom[addr], sizeof(T));
+            return t;
+        }
+        template <typename T> const T & put(int addr, const T & t)
+        {
+            if (addr >= 0 && addr + sizeof(T) <= HOST_EEPROM_SIZE)
+                memcpy(&host_eeprom[addr], &t, sizeof(T));
+            return t;
+        }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif  // _HOST_EEPROM_H_
@@ -0,0 +1,55 @@
+//
+//      USBHost_t36.h - host simulation
+//
+//      The RS-HFIQ shows up at once as a HostSerial port.  See Arduino.h in this folder.
+//
+//      Placed in the Public Domain
+//
+#ifndef _HOST_USBHOST_T36_H_
+#define _HOST_USBHOST_T36_H_
+
+#include <Arduino.h>
+
+#define USBHOST_SERIAL_8N1  0
+
+class USBHost
+{
+    public:
+        void begin(void) {}
+        void Task(void) {}
+};
+
+class USBDriver
+{
+    public:
+        operator bool() { return true; }
+        uint16_t idVendor(void) { return 0; }
+        uint16_t idProduct(void) { return 0; }
+        const uint8_t * manufacturer(void) { return NULL; }
+        const uint8_t * product(void) { return NULL; }
+        const uint8_t * serialNumber(void) { return NULL; }
+};
+
+class USBHub : public USBDriver
+{
+    public:
+        USBHub(USBHost & host) { (void) host; }
+};
+
+class USBHIDParser : public USBDriver
+{
+    public:
+        USBHIDParser(USBHost & host) { (void) host; }
+};
+
+class USBSerial : public USBDriver, public HostSerial
+{
+    public:
+        USBSerial(USBHost & host);
+        void begin(uint32_t baud, uint32_t format = USBHOST_SERIAL_8N1) { (void) baud; (void) format; }
+        operator bool() { return true; }
+};
+
+extern USBSerial * host_userial;    // the library's userial, for the replay tool to feed
+
+#endif  // _HOST_USBHOST_T36_H_
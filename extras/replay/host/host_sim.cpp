@@ -0,0 +1,119 @@
+//
+//      host_sim.cpp - simulated Teensy clock, serial ports and EEPROM for the replay tool
+//
+//      Placed in the Public Domain
+//
+#include <Arduino.h>
+#include <USBHost_t36.h>
+#include <EEPROM.h>
+#include <SDR_RS_HFIQ.h>
+
+#define POLL_US     10      // time used by one poll of an empty port
+
+uint64_t host_us = 0;
+void   (*host_pump)(void) = NULL;
+void   (*host_output)(uint8_t dir, uint8_t data) = NULL;
+
+HostSerial  Serial(RS_REC_CAT_OUT);
+USBSerial * host_userial = NULL;
+uint8_t     host_eeprom[HOST_EEPROM_SIZE];
+EEPROMClass EEPROM;
+
+void host_advance(uint32_t us)
+{
+    host_us += us;
+    if (host_pump)
+        host_pump();
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t) (host_us / 1000);
+}
+
+uint32_t micros(void)
+{
+    return (uint32_t) host_us;
+}
+
+void delay(uint32_t ms)
+{
+    host_advance(ms * 1000);
+}
+
+size_t Print::write(const uint8_t * buf, size_t len)
+{
+    size_t n = 0;
+
+    while (len--)
+        n += write(*buf++);
+    return n;
+}
+
+size_t Print::print(long n)
+{
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return write(buf);
+}
+
+size_t Print::print(unsigned long n)
+{
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "%lu", n);
+    return write(buf);
+}
+
+int Print::printf(const char * fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len > (int) sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    if (len > 0)
+        write((const uint8_t *) buf, len);
+    return len;
+}
+
+int HostSerial::available(void)
+{
+    if (rx.empty())
+        host_advance(POLL_US);
+    return rx.size();
+}
+
+int HostSerial::read(void)
+{
+    int c;
+
+    if (rx.empty())
+        return -1;
+    c = rx.front();
+    rx.pop_front();
+    return c;
+}
+
+int HostSerial::peek(void)
+{
+    return rx.empty() ? -1 : rx.front();
+}
+
+size_t HostSerial::write(uint8_t b)
+{
+    if (host_output)
+        host_output(out_dir, b);
+    return 1;
+}
+
+USBSerial::USBSerial(USBHost & host) : HostSerial(RS_REC_RADIO_OUT)
+{
+    (void) host;
+    host_userial = this;
+}
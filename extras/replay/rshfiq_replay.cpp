@@ -0,0 +1,345 @@
+//***************************************************************************************************
+//
+//      rshfiq_replay.cpp
+//
+//      Replays a wire traffic capture from SDR_RS_HFIQ::dump_recorder() through the library on a Linux PC.
+//      CAT bytes and RS-HFIQ replies are fed in at their recorded times.  The library runs in a loop like a
+//      main program: cmd_console(), service_RSHFIQ() and a *F to the radio when VFO A changes.
+//      Each CAT client in the capture gets its own port, added in the same order as setup_RSHFIQ() does.
+//      Reports CAT command latency per client for the capture and the replay and where the library's output first
+//      differs from what was recorded.
+//
+//      Build with make in this folder.  Usage:  rshfiq_replay [-s speed] [-v vfo] [-w retries] capture.bin
+//
+//      Placed in the Public Domain
+//
+//***************************************************************************************************
+
+#include <Arduino.h>
+#include <USBHost_t36.h>
+#include <SDR_RS_HFIQ.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define LOOP_US     100         // simulated main loop period
+#define HANG_US     5000000     // a single library call running longer than this is reported as a hang
+#define TAIL_US     1000000     // keep running this long after the last input so late replies are seen
+#define CONTEXT     24          // bytes shown either side of a divergence
+
+struct Event {
+    uint64_t    t;              // us from the start of the replay window
+    uint8_t     dir;
+    uint8_t     data;
+};
+
+static std::vector<Event> capture;      // recorded events after the last setup mark
+static std::vector<Event> replay;       // what the library sent this run
+static size_t   next_in = 0;            // next capture event to consider for input
+static uint64_t base_us = 0;            // host_us at the start of the replay window
+static double   speed = 0;              // 0 runs flat out, 1 is original timing, 10 is ten times faster
+static struct timespec wall_start;
+static bool     in_library = false;
+static uint64_t call_start = 0;
+static SDR_RS_HFIQ RS_HFIQ;
+static HostSerial * cat_port[RS_CAT_CLIENTS_MAX];
+static uint8_t  cat_ports = 1;          // CAT clients seen in the capture
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rshfiq_replay [-s speed] [-v vfo] [-w retries] capture.bin\n");
+    fprintf(stderr, "  -s speed    0 = as fast as possible (default), 1 = original timing, 10 = ten times faster\n");
+    fprintf(stderr, "  -v vfo      starting VFO A in Hz passed to setup_RSHFIQ() (default 7074000, 0 resumes)\n");
+    fprintf(stderr, "  -w retries  turn on verified write with this many retries, as the main program did\n");
+    exit(1);
+}
+
+static bool load_capture(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    struct RS_Rec_Header hdr;
+    struct RS_Rec_Event e;
+    std::vector<RS_Rec_Event> raw;
+    size_t start = 0;
+    uint64_t t = 0;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "RSRC", 4) || hdr.version < 1 || hdr.version > RS_REC_VERSION || hdr.event_size != sizeof(e))
+    {
+        fprintf(stderr, "%s: not an RS-HFIQ recorder dump (version %d)\n", path, RS_REC_VERSION);
+        fclose(f);
+        return false;
+    }
+    while (raw.size() < hdr.count && fread(&e, sizeof(e), 1, f) == 1)
+        raw.push_back(e);
+    fclose(f);
+    if (raw.size() != hdr.count)
+        fprintf(stderr, "warning: header says %u events, file has %zu\n", hdr.count, raw.size());
+    if (hdr.lost)
+        printf("Capture: %u older events were overwritten in the ring before the dump\n", hdr.lost);
+
+    // Start after the last setup mark, setup itself is run without comparing
+    for (size_t i = 0; i < raw.size(); i++)
+        if (raw[i].dir == RS_REC_MARK)
+            start = i + 1;
+    if (start == 0)
+        printf("Capture: no setup mark, radio traffic from setup will show as a divergence\n");
+
+    for (size_t i = start; i < raw.size(); i++)
+    {
+        if (i > start)
+            t += (uint32_t) (raw[i].t_us - raw[i-1].t_us);    // micros() wraps, the difference does not
+        if (raw[i].dir == RS_REC_MARK)
+            continue;
+        capture.push_back({t, raw[i].dir, raw[i].data});
+        if (RS_REC_DIR(raw[i].dir) <= RS_REC_CAT_OUT && RS_REC_CLIENT(raw[i].dir) >= cat_ports)
+            cat_ports = RS_REC_CLIENT(raw[i].dir) + 1;     // version 1 captures are all client 0
+    }
+    printf("Capture: %zu events over %.3f s\n", capture.size(), capture.empty() ? 0.0 : capture.back().t / 1e6);
+    return true;
+}
+
+static void output(uint8_t dir, uint8_t data)
+{
+    replay.push_back({host_us - base_us, dir, data});
+}
+
+// Keeps wall time in step with simulated time when pacing
+static void pace(void)
+{
+    struct timespec now, ts;
+    double behind;
+
+    if (speed <= 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    behind = (host_us - base_us) / 1e6 / speed - ((now.tv_sec - wall_start.tv_sec) + (now.tv_nsec - wall_start.tv_nsec) / 1e9);
+    if (behind > 0.001)
+    {
+        ts.tv_sec = (time_t) behind;
+        ts.tv_nsec = (long) ((behind - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void pump(void)
+{
+    uint64_t now = host_us - base_us;
+
+    while (next_in < capture.size() && capture[next_in].t <= now)
+    {
+        const Event & e = capture[next_in++];
+
+        if (RS_REC_DIR(e.dir) == RS_REC_CAT_IN && RS_REC_CLIENT(e.dir) < cat_ports)
+            cat_port[RS_REC_CLIENT(e.dir)]->rx.push_back(e.data);
+        else if (e.dir == RS_REC_RADIO_IN)
+            host_userial->rx.push_back(e.data);
+    }
+    if (in_library && host_us - call_start > HANG_US)
+    {
+        printf("HANG: library call started at %.6f s has not returned after %.1f s\n", (call_start - base_us) / 1e6, HANG_US / 1e6);
+        printf("      stuck waiting on a reply the capture does not contain.  %zu of %zu events replayed\n", next_in, capture.size());
+        exit(2);
+    }
+    pace();
+}
+
+// Latency from each of one client's CAT command terminators to the first byte the library sends in answer to it,
+// a reply to that client or a command to the radio, before any client's next command.  Broadcasts to the other
+// clients are not answers.  cat_in holds every client's CAT input, out every output.
+static void latency(const char * name, uint8_t client, const std::vector<Event> & cat_in, const std::vector<Event> & out)
+{
+    std::vector<Event> cmds;    // command terminators of all clients
+    uint64_t sum = 0, min = UINT64_MAX, max = 0, worst_at = 0;
+    size_t n = 0, o = 0;
+    bool last_was_eol[16] = {};
+
+    for (size_t i = 0; i < cat_in.size(); i++)
+    {
+        bool eol = cat_in[i].data == 13 || cat_in[i].data == 10;
+
+        if (eol && !last_was_eol[RS_REC_CLIENT(cat_in[i].dir)])
+            cmds.push_back(cat_in[i]);
+        last_was_eol[RS_REC_CLIENT(cat_in[i].dir)] = eol;
+    }
+    for (size_t i = 0; i < cmds.size(); i++)
+    {
+        uint64_t t = cmds[i].t;
+        uint64_t next_cmd = (i + 1 < cmds.size()) ? cmds[i+1].t : UINT64_MAX;
+
+        if (RS_REC_CLIENT(cmds[i].dir) != client)
+            continue;
+        while (o < out.size() && out[o].t < t)
+            o++;
+        while (o < out.size() && out[o].t < next_cmd && out[o].dir != RS_REC_RADIO_OUT && out[o].dir != (RS_REC_CAT_OUT | (client << 4)))
+            o++;    // broadcast to another client
+        if (o < out.size() && out[o].t < next_cmd)
+        {
+            uint64_t l = out[o].t - t;
+
+            sum += l;
+            n++;
+            if (l < min)
+                min = l;
+            if (n == 1 || l > max)
+            {
+                max = l;
+                worst_at = t;
+            }
+        }
+    }
+    if (n == 0)
+        printf("%-8s latency: no answered CAT commands\n", name);
+    else
+        printf("%-8s latency: %zu commands  min %llu us  avg %llu us  max %llu us (command at %.6f s)\n", name, n,
+            (unsigned long long) min, (unsigned long long) (sum / n), (unsigned long long) max, worst_at / 1e6);
+}
+
+// Events going one of two ways, for all CAT clients
+static std::vector<Event> select(const std::vector<Event> & ev, uint8_t dir1, uint8_t dir2)
+{
+    std::vector<Event> r;
+
+    for (size_t i = 0; i < ev.size(); i++)
+        if (RS_REC_DIR(ev[i].dir) == dir1 || RS_REC_DIR(ev[i].dir) == dir2)
+            r.push_back(ev[i]);
+    return r;
+}
+
+// Events with exactly this dir, including the client id
+static std::vector<Event> select_exact(const std::vector<Event> & ev, uint8_t dir)
+{
+    std::vector<Event> r;
+
+    for (size_t i = 0; i < ev.size(); i++)
+        if (ev[i].dir == dir)
+            r.push_back(ev[i]);
+    return r;
+}
+
+static void show(const char * label, const std::vector<Event> & s, size_t at)
+{
+    size_t from = (at > CONTEXT) ? at - CONTEXT : 0;
+
+    printf("  %-9s ", label);
+    for (size_t i = from; i < s.size() && i < at + CONTEXT; i++)
+    {
+        if (i == at)
+            printf("[");
+        if (s[i].data == 13)
+            printf("\\r");
+        else if (s[i].data == 10)
+            printf("\\n");
+        else if (isprint(s[i].data))
+            printf("%c", s[i].data);
+        else
+            printf("\\x%02x", s[i].data);
+        if (i == at)
+            printf("]");
+    }
+    printf("\n");
+}
+
+// Returns true if the byte streams match
+static bool divergence(const char * name, uint8_t dir)
+{
+    std::vector<Event> rec = select_exact(capture, dir);
+    std::vector<Event> rep = select_exact(replay, dir);
+    size_t i;
+
+    for (i = 0; i < rec.size() && i < rep.size(); i++)
+        if (rec[i].data != rep[i].data)
+            break;
+    if (i == rec.size() && i == rep.size())
+    {
+        printf("%-8s output: %zu bytes, matches the capture\n", name, rec.size());
+        return true;
+    }
+    printf("%-8s output: DIVERGES at byte %zu (captured %zu bytes, replayed %zu)\n", name, i, rec.size(), rep.size());
+    printf("  captured at %.6f s, replayed at %.6f s\n", i < rec.size() ? rec[i].t / 1e6 : -1.0, i < rep.size() ? rep[i].t / 1e6 : -1.0);
+    show("captured", rec, i);
+    show("replayed", rep, i);
+    return false;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t VFOA = 7074000, VFOB, last_VFOA;
+    uint8_t  swap_vfo = 0, band = 0, xmit = 0, split = 0;
+    int      retries = -1, opt;
+    bool     ok;
+
+    while ((opt = getopt(argc, argv, "s:v:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': speed = atof(optarg); break;
+            case 'v': VFOA = strtoul(optarg, NULL, 10); break;
+            case 'w': retries = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    if (!load_capture(argv[optind]))
+        return 1;
+
+    // Client 0 is Serial with no broadcast, the rest broadcast, as setup_RSHFIQ() sets them up
+    for (uint8_t i = 0; i < cat_ports; i++)
+    {
+        cat_port[i] = new HostSerial(RS_REC_CAT_OUT | (i << 4));
+        RS_HFIQ.add_CAT_port(cat_port[i], i != 0);
+    }
+
+    // Setup runs non-blocking with nothing compared, the capture starts after it
+    VFOB = VFOA;
+    RS_HFIQ.setup_RSHFIQ(0, &VFOA, &VFOB, &split);
+    if (retries >= 0)
+        RS_HFIQ.set_verified_write(true, retries, NULL);
+    RS_HFIQ.find_new_band(VFOA, &band);
+    last_VFOA = VFOA;
+
+    base_us = host_us;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    host_output = output;
+    host_pump = pump;
+
+    while (next_in < capture.size() || host_us - base_us < (capture.empty() ? 0 : capture.back().t) + TAIL_US)
+    {
+        in_library = true;
+        call_start = host_us;
+        RS_HFIQ.cmd_console(&swap_vfo, &VFOA, &VFOB, &band, &xmit, &split);
+        RS_HFIQ.service_RSHFIQ();
+        if (VFOA != last_VFOA)      // what a main program does with a new frequency
+        {
+            RS_HFIQ.send_variable_cmd_to_RSHFIQ("*F", RS_HFIQ.convert_freq_to_Str(VFOA));
+            last_VFOA = VFOA;
+        }
+        in_library = false;
+        host_advance(LOOP_US);
+    }
+
+    printf("Replay:  %zu events over %.3f s simulated\n", replay.size(), (host_us - base_us) / 1e6);
+    for (uint8_t i = 0; i < cat_ports; i++)
+    {
+        char name[24];
+
+        snprintf(name, sizeof(name), "CAT %d captured", i);
+        latency(name, i, select(capture, RS_REC_CAT_IN, RS_REC_CAT_IN), select(capture, RS_REC_CAT_OUT, RS_REC_RADIO_OUT));
+        snprintf(name, sizeof(name), "CAT %d replayed", i);
+        latency(name, i, select(capture, RS_REC_CAT_IN, RS_REC_CAT_IN), select(replay, RS_REC_CAT_OUT, RS_REC_RADIO_OUT));
+    }
+    ok = divergence("Radio", RS_REC_RADIO_OUT);
+    for (uint8_t i = 0; i < cat_ports; i++)
+    {
+        char name[8];
+
+        snprintf(name, sizeof(name), "CAT %d", i);
+        ok = divergence(name, RS_REC_CAT_OUT | (i << 4)) && ok;
+    }
+    return ok ? 0 : 3;
+}
@@ -19,6 +19,8 @@
 
 #include <Arduino.h>
 #include <USBHost_t36.h>
+#include <EEPROM.h>
+#include <stdarg.h>
 #include <SDR_RS_HFIQ.h>
 
 //#define DEBUG_RSHFIQ  //set to true for debug output, false for no debug output
@@ -48,12 +50,33 @@
 #define DEBUG_PRINTF(...) 
 #endif
 
-// Serial port for external CAT control
-//#define CAT_RS_Serial SerialUSB1
-#define CAT_RS_Serial Serial
+// Wire traffic recorder.  Logs every CAT and RS-HFIQ byte with a micros() timestamp into a RAM ring
+// for dump_recorder().  Replay a dump on a PC with extras/replay.
+//#define RSHFIQ_RECORDER
+#ifndef RSHFIQ_RECORDER_SIZE
+#define RSHFIQ_RECORDER_SIZE 4096   // events, 6 bytes each
+#endif
+
+// CAT ports.  setup_RSHFIQ() adds Serial, plus SerialUSB1 and SerialUSB2 when the USB Type has them,
+// unless the main program already called add_CAT_port().  Add a hardware UART with add_CAT_port(&Serial1).
+#define CAT_WRITE_HOLD_MS   500     // after a client changes something, other clients' changes are refused for this long
+#define CAT_BROADCAST_MS    50      // changes made by the main program are announced no more often than this
 
 // Teensy USB Host port
 #define USBBAUD 57600   // RS-HFIQ uses 57600 baud
+#define VERIFY_SETTLE_MS    20      // idle time after a set before the read-back query is sent.  Rapid tuning coalesces into one check
+#define VERIFY_TIMEOUT_MS   50      // give up waiting for a read-back reply after this long and count it as a mismatch
+
+// Band stack storage in the Teensy EEPROM emulation.  If the main program already uses this part of the EEPROM,
+// change these here or pass them as build flags.  A #define in the sketch does not reach this file.
+#ifndef RSHFIQ_EEPROM_BASE
+#define RSHFIQ_EEPROM_BASE  580     // first byte used.  4 records of 123 bytes end at 1071, Teensy 4.0 EEPROM is 1080 bytes
+#endif
+#ifndef RSHFIQ_EEPROM_SLOTS
+#define RSHFIQ_EEPROM_SLOTS 4       // records rotated through for wear leveling
+#endif
+#define BANDSTACK_SETTLE_MS 5000    // no band stack changes for this long before it is written out
+#define BANDSTACK_MAGIC     0x5242  // "RB"
 uint32_t baud = USBBAUD;
 uint32_t format = USBHOST_SERIAL_8N1;
 USBHost RSHFIQ;
@@ -66,31 +89,143 @@ USBHIDParser hid3(RSHFIQ);
 //#define DBG
 
 static uint32_t rs_freq;
+static uint32_t rs_lo_freq;     // last frequency sent to the radio with *F, for TX checks
 int  counter  = 0;
 int  blocking = 0;  // 0 means do not wait for serial response from RS-HFIQ - for testing only.  1 is normal
-static char S_Input[16];
 static char R_Input[20];
 
-#define RS_BANDS    9
-struct RS_Band_Memory {
-    uint8_t     band_num;        // Assigned bandnum for compat with external program tables
-    char        band_name[10];  // Friendly name or label.  Default here but can be changed by user.  Not actually used by code.
-    uint32_t    edge_lower;     // band edge limits for TX and for when to change to next band when tuning up or down.
-    uint32_t    edge_upper;
+#define RS_BANDS    9   // band numbers 1 to 9, 80M to 10M
+
+// Last used settings per band, indexed by band_num - 1.  last_VFOA of 0 means the band has not been used.
+struct __attribute__((packed)) RS_Band_Stack {
+    uint32_t    last_VFOA;
+    uint32_t    last_VFOB;
+    int32_t     offset;         // *D offset
+    uint8_t     split;
+};
+
+// One EEPROM record holds the whole band stack.  Each save goes to the next of RSHFIQ_EEPROM_SLOTS records
+// and the one with the highest seq is loaded at boot.  An interrupted write leaves the previous record intact.
+struct __attribute__((packed)) RS_Band_Stack_Record {
+    uint16_t    magic;
+    uint16_t    seq;
+    uint8_t     last_band;
+    struct RS_Band_Stack band[RS_BANDS];
+    uint8_t     checksum;
+};
+
+static_assert(RSHFIQ_EEPROM_BASE + RSHFIQ_EEPROM_SLOTS * sizeof(struct RS_Band_Stack_Record) <= E2END + 1,
+    "band stack records do not fit in the EEPROM, lower RSHFIQ_EEPROM_BASE or RSHFIQ_EEPROM_SLOTS");
+
+static struct RS_Band_Stack rs_bandstack[RS_BANDS];
+static uint8_t  rs_last_band = 0;
+static uint16_t bandstack_seq = 0;
+static uint8_t  bandstack_slot = RSHFIQ_EEPROM_SLOTS - 1;  // slot last written, the next save goes to the one after
+static bool     bandstack_dirty = false;
+static uint32_t bandstack_timer = 0;    // millis() of the last change
+
+// Built-in band plans.  See RS_Band_Memory in SDR_RS_HFIQ.h for the rules a plan must follow.
+struct RS_Band_Memory rs_bandmem[] = {
+    {  1, "80M",  3500000, 4000000, 1},
+    {  2, "WWV5", 4990000, 5330499, 0},  // 60M expanded to include coverage to lower side of WWV
+    {  2, "60M",  5330500, 5367000, 1},
+    {  3, "40M",  7000000, 7300000, 1},
+    {  4, "WWV10",9990000,10099999, 0},  // 30M expanded to include coverage to lower side of WWV
+    {  4, "30M", 10100000,10150000, 1},
+    {  5, "20M", 14000000,14350000, 1},
+    {  6, "17M", 18068000,18168000, 1},
+    {  7, "15M", 21000000,21450000, 1},
+    {  8, "12M", 24890000,24990000, 1},
+    {  9, "10M", 28000000,29600000, 1}
+};
+
+static const struct RS_Band_Memory rs_plan_iaru_r1[] = {
+    {  1, "80M",  3500000, 3800000, 1},
+    {  2, "60M",  5351500, 5366500, 1},
+    {  3, "40M",  7000000, 7200000, 1},
+    {  4, "30M", 10100000,10150000, 1},
+    {  5, "20M", 14000000,14350000, 1},
+    {  6, "17M", 18068000,18168000, 1},
+    {  7, "15M", 21000000,21450000, 1},
+    {  8, "12M", 24890000,24990000, 1},
+    {  9, "10M", 28000000,29700000, 1}
+};
+
+static const struct RS_Band_Memory rs_plan_iaru_r2[] = {
+    {  1, "80M",  3500000, 4000000, 1},
+    {  2, "60M",  5351500, 5366500, 1},
+    {  3, "40M",  7000000, 7300000, 1},
+    {  4, "30M", 10100000,10150000, 1},
+    {  5, "20M", 14000000,14350000, 1},
+    {  6, "17M", 18068000,18168000, 1},
+    {  7, "15M", 21000000,21450000, 1},
+    {  8, "12M", 24890000,24990000, 1},
+    {  9, "10M", 28000000,29700000, 1}
+};
+
+static const struct RS_Band_Memory rs_plan_iaru_r3[] = {
+    {  1, "80M",  3500000, 3900000, 1},
+    {  2, "60M",  5351500, 5366500, 1},
+    {  3, "40M",  7000000, 7200000, 1},
+    {  4, "30M", 10100000,10150000, 1},
+    {  5, "20M", 14000000,14350000, 1},
+    {  6, "17M", 18068000,18168000, 1},
+    {  7, "15M", 21000000,21450000, 1},
+    {  8, "12M", 24890000,24990000, 1},
+    {  9, "10M", 28000000,29700000, 1}
 };
 
-struct RS_Band_Memory rs_bandmem[RS_BANDS] = {
-    {  1, "80M", 3500000, 4000000},
-    {  2, "60M", 4990000, 5367000},  // expanded to include coverage to lower side of WWV
-    {  3, "40M", 7000000, 7300000},
-    {  4, "30M", 9990000,10150000},  // expanded to include coverage to lower side of WWV
-    {  5, "20M",14000000,14350000},
-    {  6, "17M",18068000,18168000},
-    {  7, "15M",21000000,21450000},
-    {  8, "12M",24890000,24990000},
-    {  9, "10M",28000000,29600000}
+// Receive anywhere the RS-HFIQ tunes.  Gaps take the band_num of the ham band below so the band stack and filters follow along.
+// TX segments are the TX segments of rs_bandmem, keep the two in step.
+static const struct RS_Band_Memory rs_plan_gen_coverage[] = {
+    {  1, "GEN",  3000000, 3499999, 0},
+    {  1, "80M",  3500000, 4000000, 1},
+    {  1, "GEN",  4000001, 5330499, 0},
+    {  2, "60M",  5330500, 5367000, 1},
+    {  2, "GEN",  5367001, 6999999, 0},
+    {  3, "40M",  7000000, 7300000, 1},
+    {  3, "GEN",  7300001,10099999, 0},
+    {  4, "30M", 10100000,10150000, 1},
+    {  4, "GEN", 10150001,13999999, 0},
+    {  5, "20M", 14000000,14350000, 1},
+    {  5, "GEN", 14350001,18067999, 0},
+    {  6, "17M", 18068000,18168000, 1},
+    {  6, "GEN", 18168001,20999999, 0},
+    {  7, "15M", 21000000,21450000, 1},
+    {  7, "GEN", 21450001,24889999, 0},
+    {  8, "12M", 24890000,24990000, 1},
+    {  8, "GEN", 24990001,27999999, 0},
+    {  9, "10M", 28000000,29600000, 1},
+    {  9, "GEN", 29600001,30000000, 0}
 };
 
+#define PLAN_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+// Indexed by RS_PLAN_xxx
+static const struct {
+    const struct RS_Band_Memory * bands;
+    uint8_t count;
+} rs_plans[] = {
+    {rs_bandmem,            PLAN_SIZE(rs_bandmem)},
+    {rs_plan_iaru_r1,       PLAN_SIZE(rs_plan_iaru_r1)},
+    {rs_plan_iaru_r2,       PLAN_SIZE(rs_plan_iaru_r2)},
+    {rs_plan_iaru_r3,       PLAN_SIZE(rs_plan_iaru_r3)},
+    {rs_plan_gen_coverage,  PLAN_SIZE(rs_plan_gen_coverage)}
+};
+
+static_assert(PLAN_SIZE(rs_plans) == RS_PLAN_COUNT, "rs_plans must have one entry per RS_PLAN_xxx");
+
+// Frequency to segment index.  Each 100KHz bucket holds the first segment that ends at or above the bucket start,
+// so a lookup checks a cached last hit then walks at most the few segments that start inside one bucket.
+#define PLAN_BUCKET_HZ      100000
+#define PLAN_BUCKETS        ((RS_PLAN_HIGH - RS_PLAN_LOW) / PLAN_BUCKET_HZ + 1)
+#define PLAN_NONE           0xFF
+
+static const struct RS_Band_Memory * rs_plan = NULL;   // current plan, set on first use
+static uint8_t  rs_plan_count = 0;
+static uint8_t  rs_plan_last = 0;                       // segment of the last successful lookup
+static uint8_t  rs_plan_index[PLAN_BUCKETS];
+
 // There is now two versions of the USBSerial class, that are both derived from a common Base class
 // The difference is on how large of transfers that it can handle.  This is controlled by
 // the device descriptor, where up to now we handled those up to 64 byte USB transfers.
@@ -101,6 +236,83 @@ USBSerial userial(RSHFIQ);  // works only for those Serial devices who transfer
 //USBSerial_BigBuffer userial(myusb, 1); // Handles anything up to 512 bytes
 //USBSerial_BigBuffer userial(myusb); // Handles up to 512 but by default only for those > 64 bytes
 
+// ************************************************* Wire I/O **************************************
+//
+//  All CAT and RS-HFIQ port traffic goes through these so the recorder sees every byte.
+//
+// *************************************************************************************************
+#ifdef RSHFIQ_RECORDER
+static struct RS_Rec_Event rec_ring[RSHFIQ_RECORDER_SIZE];
+static uint32_t rec_total = 0;  // events recorded since boot, the next one goes in rec_ring[rec_total % RSHFIQ_RECORDER_SIZE]
+
+static void rec(uint8_t dir, uint8_t data)
+{
+    struct RS_Rec_Event * e = &rec_ring[rec_total++ % RSHFIQ_RECORDER_SIZE];
+
+    e->t_us = micros();
+    e->dir = dir;
+    e->data = data;
+}
+#else
+#define rec(dir, data)  do {} while (0)
+#endif
+
+static void radio_printf(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+static void radio_printf(const char * fmt, ...)
+{
+    char buf[40];
+    int len;
+    va_list args;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    if (len > (int) sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    for (int i = 0; i < len; i++)
+        rec(RS_REC_RADIO_OUT, buf[i]);
+    userial.write((const uint8_t *) buf, len);
+}
+
+static void radio_write(uint8_t ch)
+{
+    rec(RS_REC_RADIO_OUT, ch);
+    userial.write(ch);
+}
+
+static int radio_read(void)
+{
+    int c = userial.read();
+
+    if (c >= 0)
+        rec(RS_REC_RADIO_IN, c);
+    return c;
+}
+
+static int cat_read(struct RS_CAT_Client * cl)
+{
+    int c = cl->port->read();
+
+    if (c >= 0)
+        rec(RS_REC_CAT_IN | (cl->id << 4), c);
+    return c;
+}
+
+static void cat_print(struct RS_CAT_Client * cl, const char * str)
+{
+    for (const char * p = str; *p; p++)
+        rec(RS_REC_CAT_OUT | (cl->id << 4), *p);
+    cl->port->print(str);
+}
+
+static void cat_println(struct RS_CAT_Client * cl, const char * str)
+{
+    cat_print(cl, str);
+    cat_print(cl, "\r\n");
+}
+
 USBDriver *drivers[] = {&hub1, &hub2, &hid1, &hid2, &hid3, &userial};
 #define CNT_DEVICES (sizeof(drivers)/sizeof(drivers[0]))
 const char * driver_names[CNT_DEVICES] = {"Hub1", "Hub2",  "HID1", "HID2", "HID3", "USERIAL1" };
@@ -109,11 +321,32 @@ bool driver_active[CNT_DEVICES] = {false, false, false, false};
 // ************************************************* Setup *****************************************
 //
 // *************************************************************************************************
-void SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 blocking
+uint32_t SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 blocking
 {   
-    CAT_RS_Serial.begin(115200);
+    bool resume = false;
+    char offset_str[12];
+
+    Serial.begin(115200);
+    if (cat_count == 0)     // main program did not pick its own CAT ports
+    {
+        add_CAT_port(&Serial, false);   // no unsolicited state on the console port, same as before
+        #if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+        add_CAT_port(&SerialUSB1, true);
+        #endif
+        #if defined(USB_TRIPLE_SERIAL)
+        add_CAT_port(&SerialUSB2, true);
+        #endif
+    }
     delay(100);
     DPRINTLN("\nStart of RS-HFIQ Setup"); 
+    load_band_stack();
+    if (VFO == 0 && rs_last_band)   // 0 means start on the band and frequency saved last time
+    {
+        VFO = rs_bandstack[rs_last_band-1].last_VFOA;
+        resume = (VFO != 0);
+    }
+    if (VFO == 0)
+        VFO = 7074000;
     rs_freq = VFO;
     blocking = _blocking;
     //DPRINTLN(F("Looking for USB Host Connection to RS-HFIQ"));
@@ -130,7 +363,7 @@ void SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 b
     
     while (userial.available() > 0)  // Clear out RX channel garbage if any
     {
-        DPRINTLN(userial.read());
+        DPRINTLN(radio_read());
     }
 
     send_fixed_cmd_to_RSHFIQ(q_dev_name); // get our device ID name
@@ -158,6 +391,12 @@ void SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 b
     send_variable_cmd_to_RSHFIQ(s_freq, convert_freq_to_Str(rs_freq));
     DPRINT(F("Starting Frequency (Hz): ")); DPRINTLN(convert_freq_to_Str(rs_freq));
 
+    if (resume && rs_bandstack[rs_last_band-1].offset != 0)    // the radio powers up with no offset
+    {
+        sprintf(offset_str, "%ld", (long) rs_bandstack[rs_last_band-1].offset);
+        send_variable_cmd_to_RSHFIQ(s_F_Offset, offset_str);
+    }
+
     send_fixed_cmd_to_RSHFIQ(q_F_Offset);
     DPRINT(F("F_Offset (Hz): ")); print_RSHFIQ_User(blocking);   // Print our query result
 
@@ -165,8 +404,26 @@ void SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 b
     DPRINT(F("Reported Frequency (Hz): ")); print_RSHFIQ_User(blocking);   // Print our query results
     
     DPRINTLN(F("End of RS-HFIQ Setup"));
+    rec(RS_REC_MARK, 0);
     counter = 0;
     disp_Menu();
+    return rs_freq;
+}
+
+uint32_t SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t * VFOA, uint32_t * VFOB, uint8_t * split)
+{
+    bool resume = (*VFOA == 0);
+    struct RS_Band_Stack * bs;
+
+    *VFOA = setup_RSHFIQ(_blocking, *VFOA);
+    if (!resume || rs_last_band == 0)
+        return *VFOA;
+    bs = &rs_bandstack[rs_last_band-1];
+    if (bs->last_VFOA != *VFOA)
+        return *VFOA;   // nothing was saved, started on the default frequency
+    *VFOB = (bs->last_VFOB && find_band(bs->last_VFOB) == rs_last_band) ? bs->last_VFOB : *VFOA;
+    *split = bs->split;
+    return *VFOA;
 }
 
 // The RS-HFIQ has only 1 "VFO" so does not itself care about VFO A or B or split, or which is active
@@ -174,9 +431,8 @@ void SDR_RS_HFIQ::setup_RSHFIQ(int _blocking, uint32_t VFO)  // 0 non block, 1 b
 // We need to act on the active VFO and pass back the info needed to the calling program.
 uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t * VFOB, uint8_t * rs_curr_band, uint8_t * xmit, uint8_t * split)  // returns new or unchanged active VFO value
 {
-    char c;
-    static unsigned char Ser_Flag = 0, Ser_NDX = 0;
-    static uint8_t swap_vfo_last = 0;
+    struct RS_CAT_Client * cl = NULL;
+    uint8_t i;
 
     //if (active_vfo)
         rs_freq = *VFOA;
@@ -185,17 +441,55 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
 
 //   Test code.  Passes through all chars both directions.
 /*
-    while (CAT_RS_Serial.available() > 0)    // Process any and all characters in the buffer
-        userial.write(CAT_RS_Serial.read());
+    while (Serial.available() > 0)    // Process any and all characters in the buffer
+        userial.write(Serial.read());
     while (userial.available()) 
-        CAT_RS_Serial.write(userial.read());
+        Serial.write(userial.read());
     return 0;
 */
-    while (CAT_RS_Serial.available() > 0)    // Process any and all characters in the buffer
+    service_RSHFIQ();   // check any pending verified writes before taking on new commands
+    store_band_stack(*VFOA, *VFOB, *split);     // VFO B and split changes made by the main program.  No change, no save
+    if (*xmit == 0)
+        cat_ptt_owner = NULL;   // main program unkeyed, such as on PTT release or a TX timeout
+
+    if (millis() - cat_bcast_time >= CAT_BROADCAST_MS)     // tell the CAT clients about tuning done by the main program
+        broadcast_CAT_state(NULL, *VFOA, *VFOB, *split, *xmit, *swap_vfo);
+
+    // One command per call.  Start with the client after the one served last so a busy client cannot starve the others.
+    for (i = 0; i < cat_count && cl == NULL; i++)
+    {
+        struct RS_CAT_Client * p = &cat_clients[(cat_next + i) % cat_count];
+
+        if (parse_CAT(p))
+        {
+            cl = p;
+            cat_next = (cat_next + i + 1) % cat_count;
+        }
+    }
+    if (cl == NULL)
+        return rs_freq;
+
+    cat_reply = cl;
+    rs_freq = process_CAT_cmd(cl, swap_vfo, VFOA, VFOB, rs_curr_band, xmit, split);
+    cat_reply = NULL;
+    broadcast_CAT_state(cl, *VFOA, *VFOB, *split, *xmit, *swap_vfo);    // the sender already knows
+    return rs_freq;
+}
+
+// Collects characters from one client until it has a complete command.  Returns true when one is ready.
+// Stops at the end of a command so anything after it waits for this client's next turn.
+bool SDR_RS_HFIQ::parse_CAT(struct RS_CAT_Client * cl)
+{
+    char c;
+    char * S_Input = cl->S_Input;
+    unsigned char & Ser_Flag = cl->Ser_Flag;
+    unsigned char & Ser_NDX = cl->Ser_NDX;
+
+    while (Ser_Flag != 3 && cl->port->available() > 0)    // Process characters up to the end of a command
     {
-        c = CAT_RS_Serial.read(); 
+        c = cat_read(cl); 
         c = toupper(c);
-        //CAT_RS_Serial.print(c);
+        //cl->port->print(c);
     
         if (c == '*')                   // No matter where we are in the state machine, a '*' say clear the buffer and start over.
         {
@@ -205,7 +499,7 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
             {
                 S_Input[z] = ' ';
             }
-            //CAT_RS_Serial.println(F("Start Cmd string "));
+            //cl->port->println(F("Start Cmd string "));
         } 
         else if (Ser_Flag == 1 && c != 13 && c!= 10) 
             S_Input[Ser_NDX++] = c;  // If we are in state 1 and the character isn't a <CR>, put it in the buffer
@@ -213,7 +507,7 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
         {
             S_Input[Ser_NDX] = 0;                                // terminate the input string with a null (0)
             Ser_Flag = 3;                                        // Set state to 3 to indicate a command is ready for processing
-            //CAT_RS_Serial.println(S_Input);
+            //cl->port->println(S_Input);
         }
         
         if (Ser_NDX > 15) 
@@ -261,12 +555,35 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
 */
     }
 
+    return Ser_Flag == 3;
+}
+
+// Runs one complete command from a CAT client
+uint32_t SDR_RS_HFIQ::process_CAT_cmd(struct RS_CAT_Client * cl, uint8_t * swap_vfo, uint32_t * VFOA, uint32_t * VFOB, uint8_t * rs_curr_band, uint8_t * xmit, uint8_t * split)
+{
+    static uint8_t swap_vfo_last = 0;
+    char * S_Input = cl->S_Input;
+    unsigned char & Ser_Flag = cl->Ser_Flag;
+    unsigned char & Ser_NDX = cl->Ser_NDX;
+
     // If a complete command is received, process it
     if (Ser_Flag == 3) 
     {
+        uint8_t last_band = find_band(*VFOA);  // VFO A's band.  *rs_curr_band follows VFO B after a *FB
+
         #ifdef DBG 
         DPRINT(F("RS-HFIQ: Cmd String : *")); DPRINTLN(S_Input);
         #endif
+        if (is_CAT_write(S_Input) && !CAT_write_allowed(cl, S_Input, *xmit))
+        {
+            #ifdef DBG 
+            DPRINT(F("RS-HFIQ: CAT client ")); DPRINT(cl->id); DPRINT(F(" refused: *")); DPRINTLN(S_Input);
+            #endif
+            send_CAT_state(cl, *VFOA, *VFOB, *split, *xmit, *swap_vfo);     // show it what actually stands
+            Ser_Flag = 0;
+            S_Input[0] = '\0';
+            return rs_freq;
+        }
         if (S_Input[0] == 'F' && (S_Input[1] != '?' && S_Input[2] != '?' && S_Input[1] != 'R'))
         {
             if (S_Input[1] == 'A')
@@ -280,6 +597,9 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
                 if (rs_freq)
                 {
                     *VFOA = rs_freq;
+                    if (*rs_curr_band != last_band)     // other VFO, split and offset come from the band stack
+                        recall_band_stack(*rs_curr_band, VFOB, split);
+                    store_band_stack(*VFOA, *VFOB, *split);
                     //send_variable_cmd_to_RSHFIQ(s_freq, freq_str);   
                     #ifdef DBG  
                     DPRINT("RS-HFIQ: VFOA = "); DPRINTLN(freq_str);
@@ -297,6 +617,7 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
                 if (rs_freq)
                 {
                     *VFOB = rs_freq;
+                    store_band_stack(*VFOA, *VFOB, *split);
                     //send_variable_cmd_to_RSHFIQ(s_freq, freq_str);   
                     #ifdef DBG  
                     DPRINT("RS-HFIQ: VFOB = "); DPRINTLN(freq_str);
@@ -314,6 +635,9 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
                 if (rs_freq)
                 {
                     *VFOA = rs_freq;
+                    if (*rs_curr_band != last_band)     // other VFO, split and offset come from the band stack
+                        recall_band_stack(*rs_curr_band, VFOB, split);
+                    store_band_stack(*VFOA, *VFOB, *split);
                     //send_variable_cmd_to_RSHFIQ(s_freq, freq_str);   
                     #ifdef DBG  
                     DPRINT("RS-HFIQ: Active VFO = "); DPRINTLN(freq_str);
@@ -346,7 +670,7 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
         {
             // convert string to number  
             rs_freq = atoi(&S_Input[1]);   // skip the first letter 'B' and convert the number
-            sprintf(freq_str, "%8lu", rs_freq);
+            sprintf(freq_str, "%8lu", (unsigned long) rs_freq);
             send_variable_cmd_to_RSHFIQ(s_BIT_freq, convert_freq_to_Str(rs_freq));
             #ifdef DBG
             //DPRINTLN(freq_str);
@@ -370,7 +694,7 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
         {
             // convert string to number  
             rs_freq = atoi(&S_Input[1]);   // skip the first letter 'E' and convert the number
-            sprintf(freq_str, "%8lu", rs_freq);
+            sprintf(freq_str, "%8lu", (unsigned long) rs_freq);
             send_variable_cmd_to_RSHFIQ(s_EXT_freq, convert_freq_to_Str(rs_freq));
             #ifdef DBG  
             //DPRINTLN(freq_str);
@@ -384,13 +708,25 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
             DPRINTLN(F("RS-HFIQ: XMIT OFF"));
             #endif
             *xmit = 0;
+            cat_ptt_owner = NULL;
         }
         if (!strcmp(S_Input, "X1"))
         {
             #ifdef DBG  
             DPRINTLN(F("RS-HFIQ: XMIT ON"));
             #endif
-            *xmit = 1;
+            if (tx_allowed(*split ? *VFOB : *VFOA))
+            {
+                *xmit = 1;
+                cat_ptt_owner = cl;
+            }
+            else
+            {
+                *xmit = 0;
+                #ifdef DBG  
+                DPRINTLN(F("RS-HFIQ: XMIT refused, TX frequency not in a TX allowed band segment"));
+                #endif
+            }
         }
         if (!strcmp(S_Input, "SW0"))
         {
@@ -423,22 +759,22 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
             #ifdef DBG  
             DPRINT(F("RS-HFIQ: VFO A Query - Reply: ")); DPRINTLN(*VFOA);
             #endif
-            sprintf(freq_str, "*FA%09lu", *VFOA);
+            sprintf(freq_str, "*FA%09lu", (unsigned long) *VFOA);
             #ifdef DBG  
             DPRINTLN(freq_str);
             #endif
-            CAT_RS_Serial.print(freq_str);
+            cat_print(cl, freq_str);
         }
         if (!strcmp(S_Input, "FB?")) // 
         {
             #ifdef DBG  
             DPRINT(F("RS-HFIQ: VFO B Query - Reply: ")); DPRINTLN(*VFOB);
             #endif
-            sprintf(freq_str, "*FB%09lu", *VFOB);
+            sprintf(freq_str, "*FB%09lu", (unsigned long) *VFOB);
             #ifdef DBG  
             DPRINTLN(freq_str);
             #endif
-            CAT_RS_Serial.print(freq_str);
+            cat_print(cl, freq_str);
         }
         if (!strcmp(S_Input, "F?")) 
         {
@@ -461,14 +797,16 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
         }
         else if (Ser_NDX == 0)
         {
-            userial.printf("*\r");
+            drain_verify();
+            radio_printf("*\r");
             delay(5);
             read_RSHFIQ();
             #ifdef DBG  
             DPRINT(F("RS_HFIQ * Query Answer: ")); DPRINTLN(R_Input);
             #endif
-            CAT_RS_Serial.print(R_Input);
+            cat_print(cl, R_Input);
         }
+        store_band_stack(*VFOA, *VFOB, *split);    // picks up split changes.  No change, no save
         S_Input[0] = '\0';
         for (int z = 0; z < 16; z++)  // Fill the buffer with spaces
         {
@@ -479,16 +817,306 @@ uint32_t SDR_RS_HFIQ::cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t
     return rs_freq;
 }
 
-void SDR_RS_HFIQ::send_fixed_cmd_to_RSHFIQ(const char * str)
+// ************************************************* CAT Clients ***********************************
+//
+//  Each CAT port has its own parser state.  Rules for changes (writes):
+//    - X0 is always accepted, anyone can stop a transmission.
+//    - While a client holds PTT only that client may change anything.
+//    - Otherwise the client that last changed something keeps the write lock for CAT_WRITE_HOLD_MS.
+//  Queries are always answered.  A refused client is sent the current state instead.
+//  Clients added with broadcast get every change of VFO A/B, split, TX and swap without polling.
+//
+// *************************************************************************************************
+bool SDR_RS_HFIQ::add_CAT_port(Stream * port, bool broadcast)
 {
-    userial.printf("*%s\r", str);
+    if (port == NULL || cat_count >= RS_CAT_CLIENTS_MAX)
+        return false;
+    for (uint8_t i = 0; i < cat_count; i++)
+        if (cat_clients[i].port == port)
+            return false;
+    memset(&cat_clients[cat_count], 0, sizeof(cat_clients[0]));
+    cat_clients[cat_count].port = port;
+    cat_clients[cat_count].id = cat_count;
+    cat_clients[cat_count].broadcast = broadcast;
+    cat_count++;
+    return true;
+}
+
+bool SDR_RS_HFIQ::is_CAT_write(const char * cmd)
+{
+    if (cmd[0] == 'F')
+        return cmd[1] != '?' && cmd[2] != '?';  // F, FA, FB sets and FR0/FR1
+    if (cmd[0] == 'B' || cmd[0] == 'D' || cmd[0] == 'E')
+        return cmd[1] != '?';
+    return !strcmp(cmd, "X0") || !strcmp(cmd, "X1") || !strcmp(cmd, "SW0");
+}
+
+bool SDR_RS_HFIQ::CAT_write_allowed(struct RS_CAT_Client * cl, const char * cmd, uint8_t xmit)
+{
+    if (!strcmp(cmd, "X0"))
+        return true;
+    if (xmit && cat_ptt_owner != NULL && cat_ptt_owner != cl)
+        return false;
+    if (cat_writer != NULL && cat_writer != cl && millis() - cat_write_time < CAT_WRITE_HOLD_MS && !(xmit && cat_ptt_owner == cl))
+        return false;
+    cat_writer = cl;
+    cat_write_time = millis();
+    return true;
+}
+
+// Replies look like the answers to queries so clients need no extra parsing
+static void format_CAT_state(char * str, uint8_t item, uint32_t value)
+{
+    switch (item)
+    {
+        case 0: sprintf(str, "*FA%09lu", (unsigned long) value); break;
+        case 1: sprintf(str, "*FB%09lu", (unsigned long) value); break;
+        case 2: sprintf(str, "*FR%lu", (unsigned long) value); break;
+        case 3: sprintf(str, "*X%lu", (unsigned long) value); break;
+        case 4: sprintf(str, "*SW%lu", (unsigned long) value); break;
+    }
+}
+
+void SDR_RS_HFIQ::send_CAT_state(struct RS_CAT_Client * cl, uint32_t VFOA, uint32_t VFOB, uint8_t split, uint8_t xmit, uint8_t swap_vfo)
+{
+    uint32_t state[5] = {VFOA, VFOB, split, xmit, swap_vfo};
+    char str[16];
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        format_CAT_state(str, i, state[i]);
+        cat_print(cl, str);
+    }
+}
+
+// Sends whatever changed since the last call to every broadcast client except the one that made the change
+void SDR_RS_HFIQ::broadcast_CAT_state(struct RS_CAT_Client * from, uint32_t VFOA, uint32_t VFOB, uint8_t split, uint8_t xmit, uint8_t swap_vfo)
+{
+    uint32_t state[5] = {VFOA, VFOB, split, xmit, swap_vfo};
+    char str[16];
+
+    cat_bcast_time = millis();
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        if (state[i] == cat_state[i])
+            continue;
+        cat_state[i] = state[i];
+        format_CAT_state(str, i, state[i]);
+        for (uint8_t c = 0; c < cat_count; c++)
+            if (cat_clients[c].broadcast && &cat_clients[c] != from)
+                cat_print(&cat_clients[c], str);
+    }
+}
+
+bool SDR_RS_HFIQ::send_fixed_cmd_to_RSHFIQ(const char * str)
+{
+    if (!strcmp((str[0] == '*') ? &str[1] : str, "X1") && !tx_allowed(rs_lo_freq))
+    {
+        #ifdef DBG  
+        DPRINT(F("RS-HFIQ: TX ON refused outside TX band segment at ")); DPRINTLN(rs_lo_freq);
+        #endif
+        return false;
+    }
+    drain_verify();
+    radio_printf("*%s\r", str);
     delay(5);
+    return true;
 }
 
 void SDR_RS_HFIQ::send_variable_cmd_to_RSHFIQ(const char * str, char * cmd_str)
 {
-    userial.printf("%s%s\r", str, cmd_str);
+    drain_verify();
+    radio_printf("%s%s\r", str, cmd_str);
     delay(5);
+    // *F, *E and *B sets have a matching query we can check the result with later
+    if (verify_enabled && str[0] == '*' && str[1] != '\0' && str[2] == '\0' && (str[1] == 'F' || str[1] == 'E' || str[1] == 'B'))
+        schedule_verify(str[1], strtoul(cmd_str, NULL, 10));
+    if (str[0] == '*' && str[1] != '\0' && str[2] == '\0')   // keep the band stack current.  RAM only, saved later from service_RSHFIQ()
+    {
+        uint8_t band = 0;
+        uint32_t freq = strtoul(cmd_str, NULL, 10);
+        int32_t offset = strtol(cmd_str, NULL, 10);
+
+        if (str[1] == 'F')
+            rs_lo_freq = freq;
+        if (str[1] == 'F' && find_new_band(freq, &band) && band >= 1 && band <= RS_BANDS)
+        {
+            if (rs_bandstack[band-1].last_VFOA != freq || rs_last_band != band)
+            {
+                rs_bandstack[band-1].last_VFOA = freq;
+                rs_last_band = band;
+                bandstack_dirty = true;
+            }
+            bandstack_timer = millis();
+        }
+        else if (str[1] == 'D' && rs_last_band && rs_bandstack[rs_last_band-1].offset != offset)
+        {
+            rs_bandstack[rs_last_band-1].offset = offset;
+            bandstack_dirty = true;
+            bandstack_timer = millis();
+        }
+    }
+}
+
+// ************************************************* Verified Write ********************************
+//
+//  A set has no reply so we follow it up with the matching query once the caller has stopped
+//  changing the value for VERIFY_SETTLE_MS.  The query goes out from service_RSHFIQ() and its reply
+//  is collected a character at a time as it arrives so a good write never blocks the caller.
+//
+// *************************************************************************************************
+void SDR_RS_HFIQ::set_verified_write(bool enable, uint8_t retries, RS_Verify_Error_cb err_cb)
+{
+    drain_verify();
+    verify_enabled = enable;
+    verify_retries = retries;
+    verify_err_cb = err_cb;
+    for (int i = 0; i < RS_VERIFY_SLOTS; i++)
+        verify[i].pending = false;
+}
+
+static int verify_slot(char cmd)
+{
+    switch (cmd)
+    {
+        case 'F': return 0;
+        case 'E': return 1;
+        case 'B': return 2;
+    }
+    return -1;
+}
+
+static const char verify_cmds[RS_VERIFY_SLOTS] = {'F', 'E', 'B'};
+
+void SDR_RS_HFIQ::schedule_verify(char cmd, uint32_t value)
+{
+    int i = verify_slot(cmd);
+
+    if (i < 0)
+        return;
+    verify[i].pending = true;
+    verify[i].requested = value;
+    verify[i].tries = verify_retries;
+    verify[i].timer = millis();
+}
+
+void SDR_RS_HFIQ::service_RSHFIQ(void)
+{
+    service_verify();
+    if (bandstack_dirty && millis() - bandstack_timer >= BANDSTACK_SETTLE_MS)
+        save_band_stack();
+}
+
+void SDR_RS_HFIQ::service_verify(void)
+{
+    char c;
+    int i;
+
+    if (!verify_enabled)
+        return;
+
+    if (verify_q >= 0)  // collect whatever part of the reply has arrived
+    {
+        while (userial.available() > 0)
+        {
+            c = radio_read();
+            if (c == 13 || c == 10)
+            {
+                if (verify_ndx == 0)
+                    continue;       // leftover LF from the previous reply
+                verify_reply[verify_ndx] = 0;
+                verify_lf = (c == 13);  // replies end in CR LF, the LF may still be on its way
+                eat_verify_lf();
+                finish_verify(strtoul(verify_reply, NULL, 10));
+                return;
+            }
+            if (verify_ndx < sizeof(verify_reply) - 1)
+                verify_reply[verify_ndx++] = c;
+        }
+        if (millis() - verify_q_time > VERIFY_TIMEOUT_MS)
+            finish_verify(0);
+        return;
+    }
+
+    eat_verify_lf();
+    for (i = 0; i < RS_VERIFY_SLOTS && !verify[i].pending; i++) {}
+    if (i == RS_VERIFY_SLOTS)   // nothing to check, leave the radio RX to whoever reads it
+    {
+        verify_stray_time = 0;
+        return;
+    }
+    if (userial.available() > 0)
+    {
+        // Someone else's reply is still unread, do not mix ours in with it.  Bytes nobody has
+        // picked up after VERIFY_TIMEOUT_MS while a check waits are stray and are dropped so checking can go on.
+        if (verify_stray_time == 0)
+            verify_stray_time = millis() | 1;
+        else if (millis() - verify_stray_time > VERIFY_TIMEOUT_MS)
+        {
+            while (userial.available() > 0)
+                radio_read();
+            verify_stray_time = 0;
+        }
+        return;
+    }
+    verify_stray_time = 0;
+
+    for (i = 0; i < RS_VERIFY_SLOTS; i++)
+    {
+        if (verify[i].pending && millis() - verify[i].timer >= VERIFY_SETTLE_MS)
+        {
+            radio_printf("*%c?\r", verify_cmds[i]);
+            verify_q = i;
+            verify_q_time = millis();
+            verify_ndx = 0;
+            return;     // one query on the wire at a time
+        }
+    }
+}
+
+void SDR_RS_HFIQ::finish_verify(uint32_t reported)
+{
+    struct RS_Verify * v = &verify[verify_q];
+    char cmd = verify_cmds[verify_q];
+
+    verify_q = -1;
+    if (reported == v->requested)
+    {
+        v->pending = false;
+        return;
+    }
+    #ifdef DBG
+    DPRINT(F("RS-HFIQ: Verify mismatch *")); DPRINT(cmd); DPRINT(F(" requested ")); DPRINT(v->requested); DPRINT(F(" reported ")); DPRINTLN(reported);
+    #endif
+    if (v->tries > 0)
+    {
+        v->tries--;
+        radio_printf("*%c%lu\r", cmd, (unsigned long) v->requested);     // resend and check again after it settles
+        v->timer = millis();
+        return;
+    }
+    v->pending = false;
+    if (verify_err_cb)
+        verify_err_cb(cmd, v->requested, reported);
+}
+
+// Bounded by VERIFY_TIMEOUT_MS.  Only waits when a read-back query happens to be in flight.
+void SDR_RS_HFIQ::drain_verify(void)
+{
+    while (verify_q >= 0)
+        service_verify();
+    eat_verify_lf();
+}
+
+// Drops the LF that ends a read-back reply once it shows up, so it is not taken as the start of the next reply
+void SDR_RS_HFIQ::eat_verify_lf(void)
+{
+    if (verify_lf && userial.available() > 0)
+    {
+        if (userial.peek() == 10)
+            radio_read();
+        verify_lf = false;
+    }
 }
 
 void SDR_RS_HFIQ::init_PLL(void)
@@ -505,14 +1133,14 @@ void SDR_RS_HFIQ::init_PLL(void)
 
 char * SDR_RS_HFIQ::convert_freq_to_Str(uint32_t rs_freq)
 {
-    sprintf(freq_str, "%lu", rs_freq);
+    sprintf(freq_str, "%lu", (unsigned long) rs_freq);
     send_fixed_cmd_to_RSHFIQ(freq_str);
     return freq_str;
 }
 
 void SDR_RS_HFIQ::write_RSHFIQ(int ch)
 {   
-    userial.write(ch);
+    radio_write(ch);
 } 
 
 int SDR_RS_HFIQ::read_RSHFIQ(void)
@@ -534,7 +1162,7 @@ int SDR_RS_HFIQ::read_RSHFIQ(void)
     // wait for and collect chars
     while (Ser_Flag == 1 && isAscii(c) && userial.available() > 0)
     {
-        c = userial.read(); 
+        c = radio_read(); 
         c = toupper(c);
         #ifdef DBG  
         DPRINT(c);    
@@ -548,7 +1176,7 @@ int SDR_RS_HFIQ::read_RSHFIQ(void)
         }
         if (Ser_Flag == 1 && c == 13)                         // If it is a <CR> ...
         {
-            c = userial.read(); 
+            c = radio_read(); 
             R_Input[Ser_NDX] = 0;                                // terminate the input string with a null (0)
             Ser_Flag = 0;                                        // Set state to 3 to indicate a command is ready for processing
             #ifdef DBG  
@@ -566,7 +1194,8 @@ void SDR_RS_HFIQ::print_RSHFIQ(int flag)
     if (flag)  // we are waiting for a reply (BLOCKING)
         while (userial.available() == 0) {} // Wait for delayed reply   ToDo: put a timeout in here
     read_RSHFIQ();
-    CAT_RS_Serial.println(R_Input);
+    if (cat_reply || cat_count)
+        cat_println(cat_reply ? cat_reply : &cat_clients[0], R_Input);
     return;
 }
 
@@ -659,6 +1288,149 @@ bool SDR_RS_HFIQ::refresh_RSHFIQ(void)
     return Proceed;
 }
 
+// ************************************************* Band Stack ************************************
+//
+//  Last used VFOs, offset and split per band.  Tuning only touches the RAM copy.  service_RSHFIQ() writes
+//  it to EEPROM after BANDSTACK_SETTLE_MS without changes so a spinning dial never writes flash.
+//
+// *************************************************************************************************
+static uint8_t band_stack_checksum(struct RS_Band_Stack_Record * rec)
+{
+    uint8_t sum = 0;
+    uint8_t * p = (uint8_t *) rec;
+
+    for (unsigned int i = 0; i < sizeof(*rec) - 1; i++)
+        sum += p[i];
+    return ~sum;
+}
+
+void SDR_RS_HFIQ::load_band_stack(void)
+{
+    struct RS_Band_Stack_Record rec;
+    bool found = false;
+
+    memset(rs_bandstack, 0, sizeof(rs_bandstack));
+    for (int i = 0; i < RSHFIQ_EEPROM_SLOTS; i++)
+    {
+        EEPROM.get(RSHFIQ_EEPROM_BASE + i * sizeof(rec), rec);
+        if (rec.magic != BANDSTACK_MAGIC || rec.checksum != band_stack_checksum(&rec))
+            continue;
+        if (found && (int16_t)(rec.seq - bandstack_seq) <= 0)   // wrap safe compare
+            continue;
+        found = true;
+        bandstack_seq = rec.seq;
+        bandstack_slot = i;
+        rs_last_band = (rec.last_band <= RS_BANDS) ? rec.last_band : 0;
+        memcpy(rs_bandstack, rec.band, sizeof(rs_bandstack));
+    }
+    bandstack_dirty = false;
+    #ifdef DBG
+    DPRINT(F("RS-HFIQ: Band stack loaded from slot ")); DPRINT(found ? bandstack_slot : -1); DPRINT(F(" last band ")); DPRINTLN(rs_last_band);
+    #endif
+}
+
+void SDR_RS_HFIQ::save_band_stack(void)
+{
+    struct RS_Band_Stack_Record rec;
+
+    if (!bandstack_dirty)
+        return;
+    rec.magic = BANDSTACK_MAGIC;
+    rec.seq = ++bandstack_seq;
+    rec.last_band = rs_last_band;
+    memcpy(rec.band, rs_bandstack, sizeof(rec.band));
+    rec.checksum = band_stack_checksum(&rec);
+    bandstack_slot = (bandstack_slot + 1) % RSHFIQ_EEPROM_SLOTS;
+    EEPROM.put(RSHFIQ_EEPROM_BASE + bandstack_slot * sizeof(rec), rec);
+    bandstack_dirty = false;
+    #ifdef DBG
+    DPRINT(F("RS-HFIQ: Band stack saved to slot ")); DPRINTLN(bandstack_slot);
+    #endif
+}
+
+// Files the values under VFO A's band.  A cross band split VFO B is not stored, the entry keeps its own.
+void SDR_RS_HFIQ::store_band_stack(uint32_t VFOA, uint32_t VFOB, uint8_t split)
+{
+    struct RS_Band_Stack * bs;
+    uint8_t band = find_band(VFOA);
+
+    if (band < 1 || band > RS_BANDS)
+        return;
+    bs = &rs_bandstack[band-1];
+    if (find_band(VFOB) != band)
+        VFOB = bs->last_VFOB;
+    if (bs->last_VFOA == VFOA && bs->last_VFOB == VFOB && bs->split == split && rs_last_band == band)
+        return;
+    bs->last_VFOA = VFOA;
+    bs->last_VFOB = VFOB;
+    bs->split = split;
+    rs_last_band = band;
+    bandstack_dirty = true;
+    bandstack_timer = millis();
+}
+
+// Called on a band change.  VFO A has already been set to the new frequency.
+void SDR_RS_HFIQ::recall_band_stack(uint8_t band, uint32_t * VFOB, uint8_t * split)
+{
+    struct RS_Band_Stack * bs;
+    char offset_str[12];
+
+    if (band < 1 || band > RS_BANDS)
+        return;
+    bs = &rs_bandstack[band-1];
+    if (bs->last_VFOA == 0)
+        return;     // never used, leave things as they are
+    if (bs->last_VFOB && find_band(bs->last_VFOB) == band)  // may be from another plan
+        *VFOB = bs->last_VFOB;
+    *split = bs->split;
+    if (rs_last_band >= 1 && rs_last_band <= RS_BANDS && rs_bandstack[rs_last_band-1].offset != bs->offset)
+    {
+        sprintf(offset_str, "%ld", (long) bs->offset);
+        drain_verify();
+        radio_printf("%s%s\r", s_F_Offset, offset_str);
+        delay(5);
+    }
+    #ifdef DBG
+    DPRINT(F("RS-HFIQ: Band stack recall band ")); DPRINT(band); DPRINT(F(" VFOB ")); DPRINTLN(*VFOB);
+    #endif
+}
+
+bool SDR_RS_HFIQ::get_band_stack(uint8_t band, uint32_t * VFOA, uint32_t * VFOB, int32_t * offset, uint8_t * split)
+{
+    if (band < 1 || band > RS_BANDS || rs_bandstack[band-1].last_VFOA == 0)
+        return false;
+    *VFOA = rs_bandstack[band-1].last_VFOA;
+    *VFOB = rs_bandstack[band-1].last_VFOB;
+    *offset = rs_bandstack[band-1].offset;
+    *split = rs_bandstack[band-1].split;
+    return true;
+}
+
+uint8_t SDR_RS_HFIQ::get_last_band(void)
+{
+    return rs_last_band;
+}
+
+// Binary dump of the recorder ring, see RS_Rec_Header in SDR_RS_HFIQ.h.  Send it to a port nothing else is reading,
+// or capture the CAT port with the CAT program closed.
+void SDR_RS_HFIQ::dump_recorder(Stream * port)
+{
+    struct RS_Rec_Header hdr = {{'R','S','R','C'}, RS_REC_VERSION, sizeof(struct RS_Rec_Event), 0, 0, 0};
+
+    #ifdef RSHFIQ_RECORDER
+    uint32_t total = rec_total;     // snapshot, the ring keeps filling if a caller records while we write
+
+    hdr.count = (total < RSHFIQ_RECORDER_SIZE) ? total : RSHFIQ_RECORDER_SIZE;
+    hdr.lost = total - hdr.count;
+    port->write((const uint8_t *) &hdr, sizeof(hdr));
+    for (uint32_t i = total - hdr.count; i != total; i++)
+        port->write((const uint8_t *) &rec_ring[i % RSHFIQ_RECORDER_SIZE], sizeof(struct RS_Rec_Event));
+    #else
+    port->write((const uint8_t *) &hdr, sizeof(hdr));
+    #endif
+    port->flush();
+}
+
 // For RS-HFIQ free-form frequency entry validation but can be useful for external program CAT control such as a logger program.
 // Changes to the correct band settings for the new target frequency.  
 // The active VFO will become the new frequency, the other VFO will come from the database last used frequency for that band.
@@ -666,24 +1438,15 @@ bool SDR_RS_HFIQ::refresh_RSHFIQ(void)
 //
 uint32_t SDR_RS_HFIQ::find_new_band(uint32_t new_frequency, uint8_t * rs_curr_band)
 {
-    int i;
+    int i = find_segment(new_frequency);
 
-    for (i=RS_BANDS-1; i>=0; i--)    // start at the top and look for first band that VFOA fits under bandmem[i].edge_upper
+    if (i != PLAN_NONE)
     {
+        *rs_curr_band = rs_plan[i].band_num;
         #ifdef DBG  
-        DPRINT(F("RS-HFIQ: Edge_Lower Search = ")); DPRINTLN(rs_bandmem[i].edge_lower);
+        DPRINT(F("RS-HFIQ: find_band(): New Band = ")); DPRINTLN(*rs_curr_band);
         #endif
-        if (new_frequency >= rs_bandmem[i].edge_lower && new_frequency <= rs_bandmem[i].edge_upper)  // found a band lower than new_frequency so search has ended
-        {
-            #ifdef DBG  
-            DPRINT(F("RS-HFIQ: Edge_Lower = ")); DPRINTLN(rs_bandmem[i].edge_lower);
-            #endif
-            *rs_curr_band = rs_bandmem[i].band_num;
-            #ifdef DBG  
-            DPRINT(F("RS-HFIQ: find_band(): New Band = ")); DPRINTLN(*rs_curr_band);
-            #endif
-            return new_frequency;
-        }        
+        return new_frequency;
     }
     #ifdef DBG  
     DPRINTLN(F("RS-HFIQ: Invalid Frequency Requested - Out of RS-HFIQ Band"));
@@ -691,3 +1454,79 @@ uint32_t SDR_RS_HFIQ::find_new_band(uint32_t new_frequency, uint8_t * rs_curr_ba
     return 0;  // 0 means frequency was not found in the table
 }
 
+// Returns the plan segment holding freq or PLAN_NONE.  Constant time, called on every tuning step.
+uint8_t SDR_RS_HFIQ::find_segment(uint32_t freq)
+{
+    uint8_t i;
+
+    if (rs_plan == NULL)
+        set_band_plan(RSHFIQ_BAND_PLAN);
+    if (freq >= rs_plan[rs_plan_last].edge_lower && freq <= rs_plan[rs_plan_last].edge_upper)
+        return rs_plan_last;    // usually still in the same band
+    if (freq < RS_PLAN_LOW || freq > RS_PLAN_HIGH)
+        return PLAN_NONE;
+    for (i = rs_plan_index[(freq - RS_PLAN_LOW) / PLAN_BUCKET_HZ]; i < rs_plan_count && rs_plan[i].edge_lower <= freq; i++)
+    {
+        if (freq <= rs_plan[i].edge_upper)
+        {
+            rs_plan_last = i;
+            return i;
+        }
+    }
+    return PLAN_NONE;
+}
+
+uint8_t SDR_RS_HFIQ::find_band(uint32_t freq)
+{
+    uint8_t i = find_segment(freq);
+
+    return (i != PLAN_NONE) ? rs_plan[i].band_num : 0;
+}
+
+bool SDR_RS_HFIQ::tx_allowed(uint32_t freq)
+{
+    uint8_t i = find_segment(freq);
+
+    return i != PLAN_NONE && rs_plan[i].tx_allowed;
+}
+
+bool SDR_RS_HFIQ::set_band_plan(uint8_t plan)
+{
+    if (plan >= RS_PLAN_COUNT)
+        return false;
+    return set_band_plan(rs_plans[plan].bands, rs_plans[plan].count);
+}
+
+// Validates the table then builds the bucket index.  Done once per plan change, never while tuning.
+bool SDR_RS_HFIQ::set_band_plan(const struct RS_Band_Memory * bands, uint8_t count)
+{
+    uint32_t bucket_start;
+    uint16_t b;
+    uint8_t  i;
+
+    if (bands == NULL || count == 0 || count >= PLAN_NONE)
+        return false;
+    for (i = 0; i < count; i++)
+    {
+        if (bands[i].edge_lower > bands[i].edge_upper || bands[i].edge_lower < RS_PLAN_LOW || bands[i].edge_upper > RS_PLAN_HIGH)
+            return false;
+        if (bands[i].band_num < 1 || bands[i].band_num > RS_BANDS)
+            return false;   // band_num also indexes the band stack
+        if (i > 0 && bands[i].edge_lower <= bands[i-1].edge_upper)
+            return false;   // not sorted or overlapping
+    }
+    rs_plan = bands;
+    rs_plan_count = count;
+    rs_plan_last = 0;
+    for (b = 0, i = 0; b < PLAN_BUCKETS; b++)
+    {
+        bucket_start = RS_PLAN_LOW + b * PLAN_BUCKET_HZ;
+        while (i < count && bands[i].edge_upper < bucket_start)
+            i++;
+        rs_plan_index[b] = (i < count) ? i : PLAN_NONE;
+    }
+    #ifdef DBG
+    DPRINT(F("RS-HFIQ: Band plan set, segments = ")); DPRINTLN(count);
+    #endif
+    return true;
+}
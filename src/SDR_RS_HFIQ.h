@@ -12,6 +12,74 @@
 
 #include <Arduino.h>
 
+// Called when a verified write (*F, *E or *B set) still does not read back the requested value after all retries.
+// cmd is 'F', 'E' or 'B'.  reported is 0 if the radio did not answer the query.
+typedef void (*RS_Verify_Error_cb)(char cmd, uint32_t requested, uint32_t reported);
+#define RS_VERIFY_SLOTS 3   // *F, *E and *B
+
+// Band plans.  A plan is a table of segments sorted by edge_lower with no overlaps, inside the RS-HFIQ 3-30MHz range.
+// Several segments may share a band_num, such as an RX only WWV segment next to a ham band.
+// band_num must be 1-9 (80M to 10M), it also selects the band stack entry.
+#define RS_PLAN_US              0   // US ham bands, 60M and 30M extended down to WWV for receive
+#define RS_PLAN_IARU_R1         1
+#define RS_PLAN_IARU_R2         2
+#define RS_PLAN_IARU_R3         3
+#define RS_PLAN_GEN_COVERAGE    4   // 3-30MHz receive, TX only inside the RS_PLAN_US TX segments
+#define RS_PLAN_COUNT           5   // number of built-in plans, for stepping through them in a menu
+// Plan used until set_band_plan() is called.  Change it here or with a build flag.
+// A #define in the sketch does not reach the library .cpp, use set_band_plan() from the sketch instead.
+#ifndef RSHFIQ_BAND_PLAN
+#define RSHFIQ_BAND_PLAN        RS_PLAN_US
+#endif
+#define RS_PLAN_LOW         3000000     // band plan segments must be inside this range
+#define RS_PLAN_HIGH       30000000
+
+// Wire traffic recorder.  Enable with RSHFIQ_RECORDER in SDR_RS_HFIQ.cpp.  dump_recorder() writes an RS_Rec_Header
+// then count RS_Rec_Event records, oldest first, little endian.  extras/replay reads this format.
+#define RS_REC_CAT_IN       0   // byte received from a CAT port.  CAT dir values carry the client id in the upper 4 bits
+#define RS_REC_CAT_OUT      1   // byte sent to a CAT port
+#define RS_REC_RADIO_OUT    2   // byte sent to the RS-HFIQ
+#define RS_REC_RADIO_IN     3   // byte received from the RS-HFIQ
+#define RS_REC_MARK         4   // setup_RSHFIQ() finished, data is 0
+#define RS_REC_VERSION      2   // 2 added the CAT client id
+#define RS_REC_DIR(d)       ((d) & 0x0F)
+#define RS_REC_CLIENT(d)    ((d) >> 4)
+
+struct __attribute__((packed)) RS_Rec_Header {
+    char        magic[4];       // "RSRC"
+    uint8_t     version;
+    uint8_t     event_size;     // sizeof(RS_Rec_Event)
+    uint16_t    reserved;
+    uint32_t    count;          // events that follow
+    uint32_t    lost;           // older events overwritten in the ring before the dump
+};
+
+struct __attribute__((packed)) RS_Rec_Event {
+    uint32_t    t_us;           // micros() when the byte went through.  Wraps every 71 minutes
+    uint8_t     dir;            // RS_REC_xxx
+    uint8_t     data;
+};
+
+// CAT clients.  Each port has its own command parser.
+#define RS_CAT_CLIENTS_MAX  4
+
+struct RS_CAT_Client {
+    Stream *        port;
+    uint8_t         id;             // order added, also tags this client's bytes in the recorder
+    bool            broadcast;      // send state changes without being asked
+    unsigned char   Ser_Flag;       // 1 collecting a command, 3 command ready
+    unsigned char   Ser_NDX;
+    char            S_Input[16];
+};
+
+struct RS_Band_Memory {
+    uint8_t     band_num;        // Assigned bandnum for compat with external program tables
+    char        band_name[10];  // Friendly name or label.  Default here but can be changed by user.  Not actually used by code.
+    uint32_t    edge_lower;     // band edge limits for TX and for when to change to next band when tuning up or down.
+    uint32_t    edge_upper;
+    uint8_t     tx_allowed;     // 0 for receive only segments.  *X1 is refused there.
+};
+
 class SDR_RS_HFIQ
 {
     public:
@@ -21,14 +89,32 @@ class SDR_RS_HFIQ
         // publish externally available functions
         uint32_t    cmd_console(uint8_t * swap_vfo, uint32_t * VFOA, uint32_t * VFOB, uint8_t * rs_curr_band, uint8_t * xmit, uint8_t * split); // active VFO value to possible change
                                                                     // returns new or unchanged VFO value and modified band index
-        void        setup_RSHFIQ(int _blocking, uint32_t VFO);
+        uint32_t    setup_RSHFIQ(int _blocking, uint32_t VFO);  // VFO 0 resumes the band and frequency saved last time.  Returns the frequency tuned
+        uint32_t    setup_RSHFIQ(int _blocking, uint32_t * VFOA, uint32_t * VFOB, uint8_t * split);    // same, and on resume also fills in
+                                                                                                    // VFO A and that band's saved VFO B and split
         void        send_variable_cmd_to_RSHFIQ(const char * str, char * cmd_str);
         char *      convert_freq_to_Str(uint32_t freq);
-        void        send_fixed_cmd_to_RSHFIQ(const char * str);
+        bool        send_fixed_cmd_to_RSHFIQ(const char * str);    // false if not sent: *X1 outside a TX allowed segment.  Check it before
+                                                                    // setting your own xmit flag
         uint32_t    find_new_band(uint32_t new_frequency, uint8_t * rs_curr_band);  // Validate frequency is RS-HFIQ comtaptible and retured band and frequency
                                                                                     // If freq is out of RS-HFIQ band then the freq returned is 0;
         void        print_RSHFIQ(int flag);  // reads response from RS-HFIQ and prints to the CAT terminal
         void        print_RSHFIQ_User(int flag);  // reads response from RS-HFIQ and prints to the user terminal
+        void        service_RSHFIQ(void);  // call often from loop().  Runs non-blocking background work such as verified write read-back
+                                           // and saving the band stack once the dial has settled
+        void        set_verified_write(bool enable, uint8_t retries, RS_Verify_Error_cb err_cb);  // After a *F, *E or *B set, query the radio in idle time,
+                                                                                                // compare, resend up to retries times, then call err_cb on mismatch
+        bool        get_band_stack(uint8_t band, uint32_t * VFOA, uint32_t * VFOB, int32_t * offset, uint8_t * split);  // last used values for a band
+                                                                                                // returns false if the band has never been used
+        uint8_t     get_last_band(void);    // band in use when the band stack was last saved, 0 if none saved
+        void        save_band_stack(void);  // write any unsaved band stack changes to EEPROM now, such as before power down
+        bool        set_band_plan(uint8_t plan);    // switch to one of the RS_PLAN_xxx built-in plans.  false if unknown
+        bool        set_band_plan(const struct RS_Band_Memory * bands, uint8_t count);  // switch to a custom plan.  The table must stay in memory.
+                                                                                        // false (and plan unchanged) if not sorted, overlapping or out of range
+        bool        tx_allowed(uint32_t freq);      // true if freq is inside a TX allowed segment of the current plan
+        bool        add_CAT_port(Stream * port, bool broadcast = true);  // serve another CAT program on this port.  Call begin() on it first.
+                                                                        // Up to RS_CAT_CLIENTS_MAX.  broadcast sends it state changes without polling
+        void        dump_recorder(Stream * port);   // writes the wire traffic recorder ring to port in binary.  Empty if RSHFIQ_RECORDER is off
         
     private:  
         char freq_str[15] = "7074000";  // *Fxxxx command to set LO freq, PLL Clock 0
@@ -56,5 +142,49 @@ class SDR_RS_HFIQ
         void update_VFOs(uint32_t newfreq);
         void write_RSHFIQ(int ch);
         int  read_RSHFIQ(void);
+        void schedule_verify(char cmd, uint32_t value);
+        void finish_verify(uint32_t reported);
+        void drain_verify(void);    // completes an outstanding read-back query before other radio traffic is sent
+        void service_verify(void);
+        void eat_verify_lf(void);
+        void load_band_stack(void);
+        void store_band_stack(uint32_t VFOA, uint32_t VFOB, uint8_t split);
+        void recall_band_stack(uint8_t band, uint32_t * VFOB, uint8_t * split);
+        uint8_t find_segment(uint32_t freq);    // index into the current band plan
+        uint8_t find_band(uint32_t freq);       // band_num of freq, 0 if outside the plan
+        bool parse_CAT(struct RS_CAT_Client * cl);
+        uint32_t process_CAT_cmd(struct RS_CAT_Client * cl, uint8_t * swap_vfo, uint32_t * VFOA, uint32_t * VFOB, uint8_t * rs_curr_band, uint8_t * xmit, uint8_t * split);
+        bool is_CAT_write(const char * cmd);
+        bool CAT_write_allowed(struct RS_CAT_Client * cl, const char * cmd, uint8_t xmit);
+        void send_CAT_state(struct RS_CAT_Client * cl, uint32_t VFOA, uint32_t VFOB, uint8_t split, uint8_t xmit, uint8_t swap_vfo);
+        void broadcast_CAT_state(struct RS_CAT_Client * from, uint32_t VFOA, uint32_t VFOB, uint8_t split, uint8_t xmit, uint8_t swap_vfo);
+
+        struct RS_CAT_Client cat_clients[RS_CAT_CLIENTS_MAX] = {};
+        uint8_t     cat_count = 0;
+        uint8_t     cat_next = 0;               // client to look at first on the next call, for fairness
+        struct RS_CAT_Client * cat_reply = NULL;        // client whose command is running, gets the replies
+        struct RS_CAT_Client * cat_writer = NULL;       // holds the write lock
+        uint32_t    cat_write_time = 0;         // millis() of cat_writer's last change
+        struct RS_CAT_Client * cat_ptt_owner = NULL;    // client that keyed the transmitter
+        uint32_t    cat_state[5] = {};          // VFO A, VFO B, split, xmit, swap as last broadcast
+        uint32_t    cat_bcast_time = 0;
+
+        // Verified write state.  One slot each for *F, *E and *B so a set of one does not cancel a pending check of another.
+        struct RS_Verify {
+            bool        pending;        // a set was sent and has not been confirmed yet
+            uint8_t     tries;          // resends left before err_cb is called
+            uint32_t    requested;      // value last sent
+            uint32_t    timer;          // millis() of the last set, read-back is sent after it settles
+        };
+        struct RS_Verify verify[RS_VERIFY_SLOTS] = {};
+        bool        verify_enabled = false;
+        uint8_t     verify_retries = 0;
+        RS_Verify_Error_cb verify_err_cb = NULL;
+        int8_t      verify_q = -1;      // slot with a query on the wire, -1 if none
+        uint32_t    verify_q_time = 0;  // millis() when that query was sent
+        uint8_t     verify_ndx = 0;
+        bool        verify_lf = false;      // a read-back reply ended in CR, drop the LF after it
+        uint32_t    verify_stray_time = 0;  // millis() when unread bytes were first seen while idle, 0 if none
+        char        verify_reply[16];
 };
 #endif   // _SDR_RS_HFIQ_SERIAL_H_